@@ -42,4 +42,5 @@ async function main() {
   console.log("staticString", staticString.value);
   console.log("newArray", newArray());
   console.log("__heap_base", __heap_base);
+  console.log("numa residency", wamem.vmNumaResidency(memory));
 }
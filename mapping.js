@@ -44,6 +44,11 @@ async function main() {
     const content = Buffer.from([0x10, 0x20, 0x30, 0x40, 0x50, 0x60]);
     fs.writeFileSync(FILE, content);
     const id = wamem.vmMapFile(FILE, 0x1000, 4096, false);
+    // the file is read front to back
+    wamem.vmAdvise(id, 0, 4096, "sequential");
+    console.time("prefetch");
+    await wamem.vmPrefetch(id, [[0, 4096]]);
+    console.timeEnd("prefetch");
     console.log("should be 0x20", testRead(0x1001));
 
     try {
@@ -58,7 +63,7 @@ async function main() {
   {
     const content = Buffer.from([0, 0, 0, 0, 0, 0]);
     fs.writeFileSync(FILE, content);
-    const id = wamem.vmMapFile(FILE, 0x1000, 4096, true);
+    const id = wamem.vmMapFile(FILE, 0x1000, 4096, true, "random");
     console.log("should be 0x0", testRead(0x1001));
 
     testWrite(0x1002, 42);
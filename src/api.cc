@@ -1,5 +1,8 @@
 #include <node.h>
 #include <v8.h>
+#include <uv.h>
+#include <vector>
+#include <map>
 
 #include "vm.hh"
 #include "trap.hh"
@@ -7,15 +10,117 @@
 
 namespace experiment {
 
+  // accepts a WebAssembly.Memory or its (shared) buffer, empty if neither
+  static v8::Local<v8::Value> get_buffer(v8::Local<v8::Context> context, v8::Local<v8::Value> value) {
+    if (value->IsArrayBuffer() || value->IsSharedArrayBuffer()) {
+      return value;
+    }
+
+    if (!value->IsObject()) {
+      return v8::Local<v8::Value>();
+    }
+
+    auto isolate = context->GetIsolate();
+    auto object = v8::Local<v8::Object>::Cast(value);
+    auto buffer = object->Get(context, v8::String::NewFromUtf8(isolate, "buffer").ToLocalChecked()).ToLocalChecked();
+    if (!buffer->IsArrayBuffer() && !buffer->IsSharedArrayBuffer()) {
+      return v8::Local<v8::Value>();
+    }
+
+    return buffer;
+  }
+
+  static bool parse_access_pattern(v8::Isolate* isolate, v8::Local<v8::Value> value, access_pattern &pattern) {
+    static const std::map<std::string, access_pattern> patterns = {
+      { "normal", access_pattern::normal },
+      { "sequential", access_pattern::sequential },
+      { "random", access_pattern::random },
+      { "willneed", access_pattern::willneed },
+      { "cold", access_pattern::cold },
+      { "pageout", access_pattern::pageout },
+    };
+
+    auto name = std::string(*v8::String::Utf8Value(isolate, value));
+    auto it = patterns.find(name);
+    if (it == patterns.end()) {
+      auto message = "unknown access pattern: " + name;
+      isolate->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(isolate, message.c_str()).ToLocalChecked()));
+      return false;
+    }
+
+    pattern = it->second;
+    return true;
+  }
+
+  static void throw_error(v8::Isolate* isolate, const std::string &message) {
+    isolate->ThrowException(v8::Exception::Error(v8::String::NewFromUtf8(isolate, message.c_str()).ToLocalChecked()));
+  }
+
+  static v8::Local<v8::Value> get_option(v8::Local<v8::Context> context, v8::Local<v8::Value> options, const char *name) {
+    auto isolate = context->GetIsolate();
+    if (!options->IsObject()) {
+      return v8::Undefined(isolate);
+    }
+
+    auto object = v8::Local<v8::Object>::Cast(options);
+    return object->Get(context, v8::String::NewFromUtf8(isolate, name).ToLocalChecked()).ToLocalChecked();
+  }
+
+  // options.numa = { policy: "bind" | "interleave" | "local", nodes: [0, 1] }
+  static bool parse_numa_placement(v8::Local<v8::Context> context, v8::Local<v8::Value> options, numa_placement &placement) {
+    static const std::map<std::string, numa_placement::policy_type> policies = {
+      { "none", numa_placement::policy_type::none },
+      { "bind", numa_placement::policy_type::bind },
+      { "interleave", numa_placement::policy_type::interleave },
+      { "local", numa_placement::policy_type::local },
+    };
+
+    auto isolate = context->GetIsolate();
+    auto numa = get_option(context, options, "numa");
+    if (numa->IsUndefined()) {
+      return true;
+    }
+
+    auto name = std::string(*v8::String::Utf8Value(isolate, get_option(context, numa, "policy")));
+    auto it = policies.find(name);
+    if (it == policies.end()) {
+      auto message = "unknown numa policy: " + name;
+      isolate->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(isolate, message.c_str()).ToLocalChecked()));
+      return false;
+    }
+    placement.policy = it->second;
+
+    auto nodes = get_option(context, numa, "nodes");
+    if (nodes->IsArray()) {
+      auto array = v8::Local<v8::Array>::Cast(nodes);
+      for (uint32_t i = 0; i < array->Length(); ++i) {
+        placement.nodes.push_back(array->Get(context, i).ToLocalChecked()->Int32Value(context).ToChecked());
+      }
+    }
+
+    return true;
+  }
+
   void createMemory(const v8::FunctionCallbackInfo<v8::Value>& args) {
     v8::Isolate* isolate = args.GetIsolate();
     auto context = isolate->GetCurrentContext();
 
     auto reservation_size = args[0]->Uint32Value(context).ToChecked();
 
-    auto memory = create_vm(reservation_size);
-    auto wamem = create_v8_wa_memory(isolate, memory);
-    args.GetReturnValue().Set(wamem);
+    numa_placement placement;
+    if (!parse_numa_placement(context, args[1], placement)) {
+      return;
+    }
+
+    auto shared = get_option(context, args[1], "shared")->BooleanValue(isolate);
+
+    try {
+      auto memory = create_vm(reservation_size, placement);
+      auto wamem = create_v8_wa_memory(isolate, memory, shared);
+      args.GetReturnValue().Set(wamem);
+    } catch (const std::exception &e) {
+      throw_error(isolate, e.what());
+    }
   }
 
   void vmMapFile(const v8::FunctionCallbackInfo<v8::Value>& args) {
@@ -27,8 +132,17 @@ namespace experiment {
     auto size = args[2]->Uint32Value(context).ToChecked();
     auto writable = args[3]->BooleanValue(isolate);
 
-    auto id = vm_map_file(path, offset, size, writable);
-    args.GetReturnValue().Set(id);
+    auto pattern = access_pattern::normal;
+    if (!args[4]->IsUndefined() && !parse_access_pattern(isolate, args[4], pattern)) {
+      return;
+    }
+
+    try {
+      auto id = vm_map_file(path, offset, size, writable, pattern);
+      args.GetReturnValue().Set(id);
+    } catch (const std::exception &e) {
+      throw_error(isolate, e.what());
+    }
   }
 
   void vmUnmapFile(const v8::FunctionCallbackInfo<v8::Value>& args) {
@@ -40,15 +154,199 @@ namespace experiment {
     vm_unmap_file(id);
   }
 
+  // one promise for many ranges, each range is a separate work item so that they run in parallel on the uv threadpool
+  struct prefetch_request {
+    v8::Isolate* isolate;
+    v8::Global<v8::Context> context;
+    v8::Global<v8::Promise::Resolver> resolver;
+    size_t pending;
+    std::string error;
+    // regions of the ranges, so that their reservations are not unmapped (and reused) before the work runs
+    std::vector<std::shared_ptr<memory>> owners;
+  };
+
+  struct prefetch_work {
+    uv_work_t work;
+    prefetch_request* request;
+    range absolute_range;
+    std::string error;
+  };
+
+  static void prefetch_execute(uv_work_t* work) {
+    auto prefetch = reinterpret_cast<prefetch_work*>(work->data);
+    try {
+      vm_prefetch(prefetch->absolute_range);
+    } catch (const std::exception &e) {
+      prefetch->error = e.what();
+    }
+  }
+
+  static void prefetch_complete(uv_work_t* work, int status) {
+    auto prefetch = reinterpret_cast<prefetch_work*>(work->data);
+    auto request = prefetch->request;
+    if (request->error.empty() && !prefetch->error.empty()) {
+      request->error = prefetch->error;
+    }
+    delete prefetch;
+
+    if (--request->pending > 0) {
+      return;
+    }
+
+    auto isolate = request->isolate;
+    v8::HandleScope handle_scope(isolate);
+    auto context = request->context.Get(isolate);
+    v8::Context::Scope context_scope(context);
+    // runs microtasks on exit so that continuations of the promise are not delayed
+    node::CallbackScope callback_scope(isolate, v8::Object::New(isolate), { 0, 0 });
+
+    auto resolver = request->resolver.Get(isolate);
+    if (request->error.empty()) {
+      resolver->Resolve(context, v8::Undefined(isolate)).Check();
+    } else {
+      auto message = v8::String::NewFromUtf8(isolate, request->error.c_str()).ToLocalChecked();
+      resolver->Reject(context, v8::Exception::Error(message)).Check();
+    }
+
+    delete request;
+  }
+
+  // vmPrefetch(id, [[offset, length], ...]) => Promise<void>
+  void vmPrefetch(const v8::FunctionCallbackInfo<v8::Value>& args) {
+    v8::Isolate* isolate = args.GetIsolate();
+    auto context = isolate->GetCurrentContext();
+
+    auto id = args[0]->Int32Value(context).ToChecked();
+    if (!args[1]->IsArray()) {
+      isolate->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(isolate, "ranges must be an array").ToLocalChecked()));
+      return;
+    }
+    auto array = v8::Local<v8::Array>::Cast(args[1]);
+
+    // the region is kept alive by the request, but if the mapping itself is unmapped or replaced while the work
+    // is queued, the advice goes to whatever is mapped at its place in the region by then (advice only, no data change)
+    std::vector<owned_range> ranges;
+    try {
+      for (uint32_t i = 0; i < array->Length(); ++i) {
+        auto element = array->Get(context, i).ToLocalChecked();
+        if (!element->IsArray() || v8::Local<v8::Array>::Cast(element)->Length() != 2) {
+          isolate->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(isolate, "range must be an [offset, length] pair").ToLocalChecked()));
+          return;
+        }
+
+        auto pair = v8::Local<v8::Array>::Cast(element);
+        auto offset = pair->Get(context, 0).ToLocalChecked()->Uint32Value(context).ToChecked();
+        auto length = pair->Get(context, 1).ToLocalChecked()->Uint32Value(context).ToChecked();
+        ranges.push_back(vm_mapping_range(id, offset, length));
+      }
+    } catch (const std::exception &e) {
+      isolate->ThrowException(v8::Exception::RangeError(v8::String::NewFromUtf8(isolate, e.what()).ToLocalChecked()));
+      return;
+    }
+
+    auto resolver = v8::Promise::Resolver::New(context).ToLocalChecked();
+    args.GetReturnValue().Set(resolver->GetPromise());
+
+    if (ranges.empty()) {
+      resolver->Resolve(context, v8::Undefined(isolate)).Check();
+      return;
+    }
+
+    auto request = new prefetch_request();
+    request->isolate = isolate;
+    request->context.Reset(isolate, context);
+    request->resolver.Reset(isolate, resolver);
+    request->pending = ranges.size();
+    for (const auto &owned : ranges) {
+      request->owners.push_back(owned.owner);
+    }
+
+    auto loop = node::GetCurrentEventLoop(isolate);
+    for (const auto &owned : ranges) {
+      auto prefetch = new prefetch_work();
+      prefetch->work.data = prefetch;
+      prefetch->request = request;
+      prefetch->absolute_range = owned.absolute;
+      uv_queue_work(loop, &prefetch->work, prefetch_execute, prefetch_complete);
+    }
+  }
+
+  // vmAdvise(memory | id, offset, length, pattern)
+  void vmAdvise(const v8::FunctionCallbackInfo<v8::Value>& args) {
+    v8::Isolate* isolate = args.GetIsolate();
+    auto context = isolate->GetCurrentContext();
+
+    auto offset = args[1]->Uint32Value(context).ToChecked();
+    auto length = args[2]->Uint32Value(context).ToChecked();
+
+    access_pattern pattern;
+    if (!parse_access_pattern(isolate, args[3], pattern)) {
+      return;
+    }
+
+    try {
+      if (args[0]->IsNumber()) {
+        auto id = args[0]->Int32Value(context).ToChecked();
+        vm_advise(vm_mapping_range(id, offset, length).absolute, pattern);
+        return;
+      }
+
+      auto buffer = get_buffer(context, args[0]);
+      auto native_memory = buffer.IsEmpty() ? nullptr : get_native_memory(buffer);
+      if (!native_memory) {
+        isolate->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(isolate, "not a custom memory").ToLocalChecked()));
+        return;
+      }
+
+      vm_advise(vm_memory_range(*native_memory, offset, length), pattern);
+    } catch (const std::exception &e) {
+      throw_error(isolate, e.what());
+    }
+  }
+
   void createCowMemory(const v8::FunctionCallbackInfo<v8::Value>& args) {
     v8::Isolate* isolate = args.GetIsolate();
-    // auto context = isolate->GetCurrentContext();
+    auto context = isolate->GetCurrentContext();
 
     // auto buffer_size = args[0]->Uint32Value(context).ToChecked();
 
-    auto memory = create_cow();
-    auto wamem = create_v8_wa_memory(isolate, memory);
-    args.GetReturnValue().Set(wamem);
+    numa_placement placement;
+    if (!parse_numa_placement(context, args[0], placement)) {
+      return;
+    }
+
+    auto shared = get_option(context, args[0], "shared")->BooleanValue(isolate);
+
+    try {
+      auto memory = create_cow(placement);
+      auto wamem = create_v8_wa_memory(isolate, memory, shared);
+      args.GetReturnValue().Set(wamem);
+    } catch (const std::exception &e) {
+      throw_error(isolate, e.what());
+    }
+  }
+
+  // vmNumaResidency(memory) => { [node]: bytes }
+  void vmNumaResidency(const v8::FunctionCallbackInfo<v8::Value>& args) {
+    v8::Isolate* isolate = args.GetIsolate();
+    auto context = isolate->GetCurrentContext();
+
+    auto buffer = get_buffer(context, args[0]);
+    auto native_memory = buffer.IsEmpty() ? nullptr : get_native_memory(buffer);
+    if (!native_memory) {
+      isolate->ThrowException(v8::Exception::TypeError(v8::String::NewFromUtf8(isolate, "not a custom memory").ToLocalChecked()));
+      return;
+    }
+
+    try {
+      auto result = v8::Object::New(isolate);
+      for (const auto & [node, bytes] : vm_numa_residency(*native_memory)) {
+        result->Set(context, v8::Integer::New(isolate, node), v8::Number::New(isolate, static_cast<double>(bytes))).Check();
+      }
+      args.GetReturnValue().Set(result);
+    } catch (const std::exception &e) {
+      throw_error(isolate, e.what());
+    }
   }
 
   void setupTrap(const v8::FunctionCallbackInfo<v8::Value>& args) {
@@ -62,15 +360,17 @@ namespace experiment {
     print_array_buffer_backing_store_flags(array_buffer);
   }
 
-  void init(v8::Local<v8::Object> exports) {
+  // context aware, so that workers sharing a memory can load it too
+  NODE_MODULE_INIT() {
     NODE_SET_METHOD(exports, "createMemory", createMemory);
     NODE_SET_METHOD(exports, "vmMapFile", vmMapFile);
     NODE_SET_METHOD(exports, "vmUnmapFile", vmUnmapFile);
+    NODE_SET_METHOD(exports, "vmPrefetch", vmPrefetch);
+    NODE_SET_METHOD(exports, "vmAdvise", vmAdvise);
     NODE_SET_METHOD(exports, "createCowMemory", createCowMemory);
+    NODE_SET_METHOD(exports, "vmNumaResidency", vmNumaResidency);
     NODE_SET_METHOD(exports, "setupTrap", setupTrap);
     NODE_SET_METHOD(exports, "printArrayBufferBackingStoreFlags", printArrayBufferBackingStoreFlags);
   }
 
-  NODE_MODULE(wamem, init)
-
 }
@@ -1,14 +1,18 @@
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/file.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
 
+#ifdef __linux__
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#else
 #include <sys/param.h>
 #include <sys/mount.h>
-// linux
-// #include <sys/statfs.h>
+#endif
 
 namespace oscalls {
 
@@ -40,6 +44,21 @@ namespace oscalls::wrappers {
   }
 }
 
+#ifdef __linux__
+// no glibc wrappers without libnuma
+namespace oscalls::wrappers {
+  static inline long mbind(void* addr, unsigned long len, int mode, const unsigned long* nodemask, unsigned long maxnode, unsigned flags) {
+    return ::syscall(SYS_mbind, addr, len, mode, nodemask, maxnode, flags);
+  }
+  static inline long move_pages(int pid, unsigned long count, void** pages, const int* nodes, int* status, int flags) {
+    return ::syscall(SYS_move_pages, pid, count, pages, nodes, status, flags);
+  }
+  static inline long getcpu(unsigned* cpu, unsigned* node) {
+    return ::syscall(SYS_getcpu, cpu, node, nullptr);
+  }
+}
+#endif
+
 namespace oscalls {
 
   int open(const char* pathname, int flags) {
@@ -82,10 +101,31 @@ namespace oscalls {
     call("munmap", ::munmap, -1, addr, length);
   }
 
+  void madvise(void* addr, size_t len, int advice) {
+    call("madvise", ::madvise, -1, addr, len, advice);
+  }
+
   void mlock(const void* addr, size_t len) {
     call("mlock", ::mlock, -1, addr, len);
   }
 
+#ifdef __linux__
+  void mbind(void* addr, unsigned long len, int mode, const unsigned long* nodemask, unsigned long maxnode, unsigned flags) {
+    call("mbind", wrappers::mbind, -1L, addr, len, mode, nodemask, maxnode, flags);
+  }
+
+  // with nodes == nullptr, only query the node of each page in status
+  void move_pages(int pid, unsigned long count, void** pages, const int* nodes, int* status, int flags) {
+    call("move_pages", wrappers::move_pages, -1L, pid, count, pages, nodes, status, flags);
+  }
+
+  unsigned getnode() {
+    unsigned cpu, node;
+    call("getcpu", wrappers::getcpu, -1L, &cpu, &node);
+    return node;
+  }
+#endif
+
   void flock(int fd, int operation) {
     call("flock", ::flock, -1, fd, operation);
   }
@@ -20,8 +20,14 @@ static void signal_handler(int sig, siginfo_t *info, void *ucontext) {
   if(sig == SIGBUS || sig == SIGSEGV) {
 
     ucontext_t* uc = reinterpret_cast<ucontext_t*>(ucontext);
-    auto* context_rip = &uc->uc_mcontext->__ss.__rip; // OSX only, cf v8 code for linux
+#if defined(__linux__) && defined(__x86_64__)
+    uintptr_t fault_addr = uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__linux__) && defined(__aarch64__)
+    uintptr_t fault_addr = uc->uc_mcontext.pc;
+#else
+    auto* context_rip = &uc->uc_mcontext->__ss.__rip; // OSX only
     uintptr_t fault_addr = *context_rip;
+#endif
     std::cout << get_sig(sig) << " " << info->si_addr << " from instruction at " << reinterpret_cast<void *>(fault_addr) << std::endl;
 
     if(experiment::handle_cow(reinterpret_cast<uintptr_t>(info->si_addr))) {
@@ -29,8 +35,13 @@ static void signal_handler(int sig, siginfo_t *info, void *ucontext) {
       return;
     }
 
-    // on OSX v8 handle SIGBUS only
-    if (v8::V8::TryHandleSignal(SIGBUS, info, ucontext)) { // TryHandleWebAssemblyTrapPosix
+    // on OSX v8 handle SIGBUS only, SIGSEGV on linux
+#ifdef __linux__
+    const int v8_sig = SIGSEGV;
+#else
+    const int v8_sig = SIGBUS;
+#endif
+    if (v8::V8::TryHandleSignal(v8_sig, info, ucontext)) { // TryHandleWebAssemblyTrapPosix
       std::cout << "TryHandleSignal success" << std::endl;
       return;
     }
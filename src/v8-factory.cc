@@ -1,5 +1,7 @@
 #include <node.h>
 #include <v8.h>
+#include <map>
+#include <mutex>
 
 #include "vm.hh"
 #include "v8-factory.hh"
@@ -12,7 +14,11 @@
 // definition of BackingStore v8 structure, to be able to change their flags
 namespace v8_structure_mapping {
 
-  class SharedWasmMemoryData;
+  // https://github.com/v8/v8/blob/dc712da548c7fb433caed56af9a021d964952728/src/objects/backing-store.cc
+  // attached isolates, filled by v8 when a WasmMemoryObject is created on the buffer (including postMessage)
+  struct SharedWasmMemoryData {
+    std::vector<v8::internal::Isolate*> isolates_;
+  };
 
   struct BackingStore {
 
@@ -131,11 +137,64 @@ namespace {
     delete holder;
   }
 
+  constexpr size_t kWasmPageSize = 0x10000; // 64kb
+
+  // a shared wasm store uses the deleter slot for SharedWasmMemoryData, and v8 would tear it down as its own
+  // wasm memory (freeing pages it did not allocate). So shared stores and their native memory are pinned here
+  // for the life of the process: the store is never destroyed, and v8 never frees its pages.
+  // This leaks the reservation (10 GiB of address space) of each shared memory until exit.
+  struct shared_entry {
+    std::shared_ptr<v8::BackingStore> backing_store;
+    std::shared_ptr<experiment::memory> native_memory;
+  };
+
+  static std::mutex shared_registry_mutex;
+
+  // never destroyed: stores must not be released after v8 is disposed at exit
+  static std::map<void *, shared_entry> &shared_registry() {
+    static auto registry = new std::map<void *, shared_entry>();
+    return *registry;
+  }
+
 }
 
 namespace experiment {
 
-  v8::Local<v8::Object> create_v8_wa_memory(v8::Isolate* isolate, std::shared_ptr<memory> native_memory) {
+  static v8::Local<v8::Object> create_v8_shared_wa_memory(v8::Isolate* isolate, std::shared_ptr<memory> native_memory) {
+    auto backing_store = v8::SharedArrayBuffer::NewBackingStore(
+        native_memory->data(), native_memory->size(),
+        v8::BackingStore::EmptyDeleter, nullptr);
+
+    auto internal_store = reinterpret_cast<v8_structure_mapping::BackingStore *>(backing_store.get());
+    internal_store->has_guard_regions_ = true;
+    internal_store->is_wasm_memory_ = true;
+    internal_store->is_shared_ = true;
+    internal_store->custom_deleter_ = false;
+    internal_store->empty_deleter_ = false;
+    internal_store->type_specific_data_.shared_wasm_memory_data = new v8_structure_mapping::SharedWasmMemoryData();
+
+    std::cout << "create_v8_shared_wa_memory: data=" << native_memory->data() << std::endl;
+
+    auto buffer = v8::SharedArrayBuffer::New(isolate, std::move(backing_store));
+
+    {
+      std::lock_guard<std::mutex> lock(shared_registry_mutex);
+      shared_registry()[native_memory->data()] = shared_entry { buffer->GetBackingStore(), native_memory };
+    }
+
+    // WasmMemoryObject::New attaches the isolate to the shared data of the store
+    auto handle = v8_internal_utils::OpenHandle<v8::internal::JSArrayBuffer>(*buffer);
+    auto internal_isolate = reinterpret_cast<v8::internal::Isolate *>(isolate);
+    auto pages = static_cast<uint32_t>(native_memory->size() / kWasmPageSize);
+    auto new_memory = v8::internal::WasmMemoryObject::New(internal_isolate, handle, pages);
+    return v8_internal_utils::ToLocal<v8::Object>(new_memory);
+  }
+
+  v8::Local<v8::Object> create_v8_wa_memory(v8::Isolate* isolate, std::shared_ptr<memory> native_memory, bool shared) {
+    if (shared) {
+      return create_v8_shared_wa_memory(isolate, native_memory);
+    }
+
     auto holder = new shared_ptr_holder();
     holder->ptr = native_memory;
     // void *callback = &(backing_store_deleter);
@@ -161,6 +220,32 @@ namespace experiment {
     return v8_internal_utils::ToLocal<v8::Object>(new_memory);
   }
 
+  std::shared_ptr<memory> get_native_memory(v8::Local<v8::Value> buffer) {
+    std::shared_ptr<v8::BackingStore> backing_store;
+    if (buffer->IsArrayBuffer()) {
+      backing_store = v8::Local<v8::ArrayBuffer>::Cast(buffer)->GetBackingStore();
+    } else if (buffer->IsSharedArrayBuffer()) {
+      backing_store = v8::Local<v8::SharedArrayBuffer>::Cast(buffer)->GetBackingStore();
+    } else {
+      return nullptr;
+    }
+
+    auto internal_store = reinterpret_cast<v8_structure_mapping::BackingStore *>(backing_store.get());
+
+    if (internal_store->is_shared_) {
+      std::lock_guard<std::mutex> lock(shared_registry_mutex);
+      auto it = shared_registry().find(internal_store->buffer_start_);
+      return it == shared_registry().end() ? nullptr : it->second.native_memory;
+    }
+
+    if (!internal_store->custom_deleter_ || internal_store->type_specific_data_.deleter.callback != &(backing_store_deleter)) {
+      return nullptr;
+    }
+
+    auto holder = reinterpret_cast<shared_ptr_holder *>(internal_store->type_specific_data_.deleter.data);
+    return holder->ptr;
+  }
+
   void print_array_buffer_backing_store_flags(v8::Local<v8::ArrayBuffer> buffer) {
     auto backing_store = buffer->GetBackingStore();
     auto internal_store = reinterpret_cast<v8_structure_mapping::BackingStore *>(backing_store.get());
@@ -1,6 +1,9 @@
 #pragma once
 
 namespace experiment {
-  v8::Local<v8::Object> create_v8_wa_memory(v8::Isolate* isolate, std::shared_ptr<memory> native_memory);
+  // shared memory is backed by a SharedArrayBuffer, it can be posted to workers
+  v8::Local<v8::Object> create_v8_wa_memory(v8::Isolate* isolate, std::shared_ptr<memory> native_memory, bool shared = false);
+  // native memory behind a (Shared)ArrayBuffer created by create_v8_wa_memory, nullptr otherwise
+  std::shared_ptr<memory> get_native_memory(v8::Local<v8::Value> buffer);
   void print_array_buffer_backing_store_flags(v8::Local<v8::ArrayBuffer> buffer);
 }
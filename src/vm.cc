@@ -2,8 +2,10 @@
 #include <node.h>
 #include <v8.h>
 #include <sstream>
-#include <set>
 #include <map>
+#include <vector>
+#include <mutex>
+#include <atomic>
 
 #include "vm.hh"
 #include "ryu-os-calls.hh"
@@ -59,7 +61,73 @@ namespace experiment {
     return reinterpret_cast<void *>(ptr);
   }
 
-  static uintptr_t vm_allocate(uintptr_t address, std::size_t size, int prot, int fd = -1) {
+  // numa_placement resolved once at creation, ready to be given to mbind
+  struct numa_binding {
+    int mode = 0;
+    std::vector<unsigned long> nodemask;
+
+    bool is_default() const {
+      return nodemask.empty();
+    }
+  };
+
+  // linux mempolicy modes, cf numaif.h
+  constexpr int kMpolPreferred = 1;
+  constexpr int kMpolBind = 2;
+  constexpr int kMpolInterleave = 3;
+  constexpr size_t kNodeMaskBits = 8 * sizeof(unsigned long);
+
+  static numa_binding resolve_placement(const numa_placement &placement) {
+    numa_binding binding;
+    if (placement.policy == numa_placement::policy_type::none) {
+      return binding;
+    }
+
+#ifdef __linux__
+    auto nodes = placement.nodes;
+    if (placement.policy == numa_placement::policy_type::local) {
+      // local to the creating thread, so that the instance can be pinned with its memory
+      nodes = { static_cast<int>(oscalls::getnode()) };
+    }
+
+    if (nodes.empty()) {
+      throw std::runtime_error("numa placement requires at least one node");
+    }
+
+    switch (placement.policy) {
+      case numa_placement::policy_type::interleave: binding.mode = kMpolInterleave; break;
+      // preferred only: spills to other nodes once the local one is full instead of failing
+      case numa_placement::policy_type::local: binding.mode = kMpolPreferred; break;
+      default: binding.mode = kMpolBind; break;
+    }
+    for (auto node : nodes) {
+      if (node < 0) {
+        throw std::runtime_error("invalid numa node");
+      }
+
+      auto word = node / kNodeMaskBits;
+      if (word >= binding.nodemask.size()) {
+        binding.nodemask.resize(word + 1, 0);
+      }
+      binding.nodemask[word] |= 1UL << (node % kNodeMaskBits);
+    }
+#else
+    throw std::runtime_error("numa placement not supported on this platform");
+#endif
+
+    return binding;
+  }
+
+  // must be applied before first touch, as pages are placed on fault
+  static void vm_bind(uintptr_t address, std::size_t size, const numa_binding &binding) {
+#ifdef __linux__
+    if (!binding.is_default()) {
+      oscalls::mbind(as_ptr(address), size, binding.mode, binding.nodemask.data(), binding.nodemask.size() * kNodeMaskBits + 1, 0u);
+    }
+#endif
+  }
+
+  static uintptr_t vm_allocate(uintptr_t address, std::size_t size, int prot, int fd = -1, const numa_binding *binding = nullptr) {
     auto flags = 0;
     if (fd != -1) {
       flags |= MAP_SHARED;
@@ -71,38 +139,166 @@ namespace experiment {
       flags |= MAP_FIXED;
     }
 
-    return as_ptr(oscalls::mmap(as_ptr(address), size, prot, flags, fd, 0));
+    auto allocated = as_ptr(oscalls::mmap(as_ptr(address), size, prot, flags, fd, 0));
+
+    if (binding) {
+      vm_bind(allocated, size, *binding);
+    }
+
+    return allocated;
   }
 
   static void vm_deallocate(uintptr_t address, std::size_t size) {
     oscalls::munmap(as_ptr(address), size);
   }
 
+  // populate page tables for the range so that wasm code does not pay one fault per page
+  // MADV_POPULATE_READ is linux >= 5.14 only, otherwise fallback to readahead
+  // it also fails with EFAULT on pages past the end of the file, mappings are often larger than their file
+  static void vm_populate(uintptr_t address, std::size_t size) {
+#ifdef MADV_POPULATE_READ
+    if (::madvise(as_ptr(address), size, MADV_POPULATE_READ) == 0) {
+      return;
+    }
+
+    if (errno != EINVAL && errno != EFAULT) {
+      std::ostringstream oss;
+      oss << errno << " madvise(MADV_POPULATE_READ) os call error";
+      throw std::runtime_error(oss.str());
+    }
+#endif
+
+    oscalls::madvise(as_ptr(address), size, MADV_WILLNEED);
+  }
+
+  static int get_advice(access_pattern pattern) {
+    switch(pattern) {
+      case access_pattern::normal: return MADV_NORMAL;
+      case access_pattern::sequential: return MADV_SEQUENTIAL;
+      case access_pattern::random: return MADV_RANDOM;
+      case access_pattern::willneed: return MADV_WILLNEED;
+#ifdef MADV_COLD
+      case access_pattern::cold: return MADV_COLD;
+#endif
+#ifdef MADV_PAGEOUT
+      case access_pattern::pageout: return MADV_PAGEOUT;
+#endif
+      default: throw std::runtime_error("access pattern not supported on this platform");
+    }
+  }
+
+  static void vm_madvise(uintptr_t address, std::size_t size, int advice) {
+    oscalls::madvise(as_ptr(address), size, advice);
+  }
+
+  // madvise requires a page aligned address
+  static range page_aligned(const range &absolute_range) {
+    if (absolute_range.size == 0) {
+      return range { absolute_range.address, 0 };
+    }
+
+    const size_t page_size = 4096;
+    const size_t mask = page_size - 1;
+    const auto begin = absolute_range.address & ~mask;
+    const auto end = absolute_range.address + absolute_range.size;
+    return range { begin, end - begin };
+  }
+
   // ---------------------------------------------------------------------------
   // COW
   // ---------------------------------------------------------------------------
 
-  struct cow_memory;
+  // data addresses of live cow memories, 0 for a free slot
+  // read from the signal handler, so lock free: faults may happen on several threads with shared memory
+  constexpr size_t kMaxCowMemories = 64;
+  static_assert(std::atomic<uintptr_t>::is_always_lock_free);
+  static std::atomic<uintptr_t> cow_registry[kMaxCowMemories];
+
+  // async-signal-safe log: std::cout locks and allocates, and several threads may fault at once
+  static void log_cow(uintptr_t fault_data_address, uintptr_t offset) {
+    char buffer[64];
+    size_t length = 0;
 
-  // TODO: use map to better access if we want to keep it
-  static std::set<cow_memory *> cow_registry;
+    auto append = [&](const char *text) {
+      while (*text && length < sizeof(buffer)) {
+        buffer[length++] = *text++;
+      }
+    };
+
+    auto append_hex = [&](uintptr_t value) {
+      append("0x");
+      char digits[2 * sizeof(uintptr_t)];
+      size_t count = 0;
+      do {
+        digits[count++] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+      } while (value != 0);
+      while (count > 0 && length < sizeof(buffer)) {
+        buffer[length++] = digits[--count];
+      }
+    };
+
+    append("handling cow at ");
+    append_hex(fault_data_address);
+    append(" offset = ");
+    append_hex(offset);
+    append("\n");
+
+    auto written = ::write(STDOUT_FILENO, buffer, length);
+    (void)written;
+  }
+
+  // called from the signal handler: no lock, no allocation, no exception
+  static bool try_handle_cow(uintptr_t data, uintptr_t fault_data_address) {
+    if (fault_data_address < data || fault_data_address >= data + VM_ALLOCATABLE_SIZE) {
+      return false;
+    }
+
+    const size_t page_size = 4096;
+    const size_t mask = page_size - 1;
+    const auto fault_base_address = fault_data_address & ~mask;
+
+    // mprotect is idempotent: when two threads fault on the same page, the second one does not
+    // replace the page (and the writes) of the first one, as a new mapping would
+    if (::mprotect(as_ptr(fault_base_address), page_size, PROT_READ | PROT_WRITE) != 0) {
+      return false;
+    }
+
+    log_cow(fault_data_address, fault_base_address - data);
+    return true;
+  }
 
   // memory with COW to log memory accesses
   struct cow_memory : public memory {
-    cow_memory() {
+    cow_memory(const numa_placement &placement) {
+      auto binding = resolve_placement(placement);
+
       // TODO: test hugepages
       _base = vm_allocate(0, VM_RESERVATION_SIZE, PROT_NONE);
       _data = _base + VM_BASE_OFFSET;
 
+      try {
+        // the policy sticks to the range when pages are made accessible on fault
+        vm_bind(_data, VM_ALLOCATABLE_SIZE, binding);
+        register_data();
+      } catch (...) {
+        // no dtor when the ctor throws
+        vm_deallocate(_base, VM_RESERVATION_SIZE);
+        throw;
+      }
+
       std::cout << "vm data: " << as_ptr(_data) << std::endl;
       std::cout << "vm base end: " << as_ptr(_data + VM_ALLOCATABLE_SIZE) << std::endl;
-
-      cow_registry.emplace(this);
     }
 
     virtual ~cow_memory() {
+      for (auto &slot : cow_registry) {
+        auto expected = _data;
+        if (slot.compare_exchange_strong(expected, 0)) {
+          break;
+        }
+      }
       vm_deallocate(_base, VM_RESERVATION_SIZE); // TODO: verify that it does unmap inner mappings
-      cow_registry.erase(this);
     }
 
     virtual void *data() const override {
@@ -113,29 +309,26 @@ namespace experiment {
       return VM_ALLOCATABLE_SIZE;
     }
 
-    bool try_handle_cow(uintptr_t fault_data_address) {
-      if (fault_data_address >= _data && fault_data_address < _data + VM_ALLOCATABLE_SIZE) {
-        const size_t page_size = 4096;
-        const size_t mask = page_size - 1;
-        const auto fault_base_address = fault_data_address & ~mask;
-
-        vm_allocate(fault_base_address, page_size, PROT_READ | PROT_WRITE);
-
-        std::cout << "handling cow at " << as_ptr(fault_data_address) << " offset = " << as_ptr(fault_base_address - _data) << std::endl;
-        return true;
+  private:
+    void register_data() {
+      for (auto &slot : cow_registry) {
+        uintptr_t expected = 0;
+        if (slot.compare_exchange_strong(expected, _data)) {
+          return;
+        }
       }
 
-      return false;
+      throw std::runtime_error("too many cow memories");
     }
 
-  private:
     uintptr_t _data;
     uintptr_t _base;
   };
 
   bool handle_cow(uintptr_t fault_data_address) {
-    for(auto cow : cow_registry) {
-      if(cow->try_handle_cow(fault_data_address)) {
+    for (const auto &slot : cow_registry) {
+      auto data = slot.load();
+      if (data != 0 && try_handle_cow(data, fault_data_address)) {
         return true;
       }
     }
@@ -143,8 +336,8 @@ namespace experiment {
     return false;
   }
 
-  std::shared_ptr<memory> create_cow() {
-    return std::make_shared<cow_memory>();
+  std::shared_ptr<memory> create_cow(const numa_placement &placement) {
+    return std::make_shared<cow_memory>(placement);
   }
 
   // ---------------------------------------------------------------------------
@@ -152,9 +345,12 @@ namespace experiment {
   // ---------------------------------------------------------------------------
 
   struct mapping {
-    mapping(int id, const std::string &path, uintptr_t address, size_t size, bool writable)
+    mapping(int id, const std::string &path, uintptr_t address, size_t size, bool writable, access_pattern pattern)
      : _address(address)
      , _size(size) {
+      // resolved first, so that an unsupported pattern fails before anything is mapped
+      auto advice = get_advice(pattern);
+
       int fd = oscalls::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
 
       int flags = PROT_READ;
@@ -165,6 +361,16 @@ namespace experiment {
       vm_allocate(_address, _size, flags, fd);
 
       close(fd);
+
+      if (pattern != access_pattern::normal) {
+        try {
+          vm_madvise(_address, _size, advice);
+        } catch (...) {
+          // not registered in the region yet, so the dtor would not run
+          vm_allocate(_address, _size, PROT_NONE);
+          throw;
+        }
+      }
     }
 
     ~mapping() {
@@ -180,7 +386,18 @@ namespace experiment {
       auto enda = address + size;
       auto startb = _address;
       auto endb = _address + _size;
-      return starta <= endb && startb <= enda;
+      // ends are exclusive: touching ranges do not overlap
+      return starta < endb && startb < enda;
+    }
+
+    range absolute(uintptr_t offset, size_t size) const {
+      if (offset > _size || size > _size - offset) {
+        std::ostringstream oss;
+        oss << "range " << offset << "+" << size << " out of mapping of size " << _size;
+        throw std::runtime_error(oss.str());
+      }
+
+      return range { _address + offset, size };
     }
 
   private:
@@ -189,13 +406,21 @@ namespace experiment {
   };
     
   struct region : public memory {
-    region(size_t reservation_size)
+    region(size_t reservation_size, const numa_placement &placement)
      : _reservation_size(reservation_size), _mapping_id_counter(0) {
+      auto binding = resolve_placement(placement);
+
       // TODO: test hugepages
       _base = vm_allocate(0, VM_RESERVATION_SIZE, PROT_NONE);
       _data = _base + VM_BASE_OFFSET;
 
-      vm_allocate(heap_base(), heap_size(), PROT_READ | PROT_WRITE);
+      try {
+        vm_allocate(heap_base(), heap_size(), PROT_READ | PROT_WRITE, -1, &binding);
+      } catch (...) {
+        // no dtor when the ctor throws
+        vm_deallocate(_base, VM_RESERVATION_SIZE);
+        throw;
+      }
 
       std::cout << "vm data: " << as_ptr(_data) << " -> " << as_ptr(_data + VM_ALLOCATABLE_SIZE) << std::endl;
       std::cout << "vm heap: " << as_ptr(heap_base()) << " -> " << as_ptr(heap_base() + heap_size()) << std::endl;
@@ -203,6 +428,8 @@ namespace experiment {
     }
 
     virtual ~region() {
+      // mappings reset their range to PROT_NONE, it must still be reserved
+      _mappings.clear();
       vm_deallocate(_base, VM_RESERVATION_SIZE); // TODO: verify that it does unmap inner mappings
     }
 
@@ -214,7 +441,8 @@ namespace experiment {
       return VM_ALLOCATABLE_SIZE;
     }
 
-    int map_file(const std::string &path, uintptr_t offset, size_t size, bool writable) {
+    int map_file(const std::string &path, uintptr_t offset, size_t size, bool writable, access_pattern pattern) {
+      std::lock_guard<std::mutex> lock(_mappings_mutex);
       auto address = absolute(offset);
       for(const auto & [id, mapping]: _mappings) {
         if(mapping->is_overlap(address, size)) {
@@ -224,14 +452,27 @@ namespace experiment {
       }
 
       auto id = ++_mapping_id_counter;
-      _mappings.emplace(id, std::make_unique<mapping>(id, path, address, size, writable));
+      _mappings.emplace(id, std::make_unique<mapping>(id, path, address, size, writable, pattern));
       return id;
     }
 
     void unmap_file(int id) {
+      std::lock_guard<std::mutex> lock(_mappings_mutex);
       _mappings.erase(id);
     }
 
+    range mapping_range(int id, uintptr_t offset, size_t size) const {
+      std::lock_guard<std::mutex> lock(_mappings_mutex);
+      auto it = _mappings.find(id);
+      if (it == _mappings.end()) {
+        std::ostringstream oss;
+        oss << "unknown mapping id " << id;
+        throw std::runtime_error(oss.str());
+      }
+
+      return it->second->absolute(offset, size);
+    }
+
   private:
     uintptr_t heap_base() const {
       return _data + _reservation_size;
@@ -257,22 +498,86 @@ namespace experiment {
     uintptr_t _data;
     size_t _reservation_size;
     int _mapping_id_counter;
+    // mappings can be changed from several isolates (workers) with shared memory
+    mutable std::mutex _mappings_mutex;
     std::map<int, std::unique_ptr<mapping>> _mappings;
   };
 
   // for now store it globally here as a crado
+  // accessed atomically, as workers may use it while the main thread replaces it
   static std::shared_ptr<region> global_region;
 
-  std::shared_ptr<memory> create_vm(size_t reservation_size) {
-    global_region = std::make_shared<region>(reservation_size);
-    return global_region;
+  std::shared_ptr<memory> create_vm(size_t reservation_size, const numa_placement &placement) {
+    auto new_region = std::make_shared<region>(reservation_size, placement);
+    std::atomic_store(&global_region, new_region);
+    return new_region;
   }
 
-  int vm_map_file(const std::string &path, uintptr_t offset, size_t size, bool writable) {
-    return global_region->map_file(path, offset, size, writable);
+  int vm_map_file(const std::string &path, uintptr_t offset, size_t size, bool writable, access_pattern pattern) {
+    return std::atomic_load(&global_region)->map_file(path, offset, size, writable, pattern);
   }
 
   void vm_unmap_file(int id) {
-    return global_region->unmap_file(id);
+    return std::atomic_load(&global_region)->unmap_file(id);
+  }
+
+  owned_range vm_mapping_range(int id, uintptr_t offset, size_t size) {
+    auto owner = std::atomic_load(&global_region);
+    return owned_range { owner->mapping_range(id, offset, size), owner };
+  }
+
+  range vm_memory_range(const memory &mem, uintptr_t offset, size_t size) {
+    if (offset > mem.size() || size > mem.size() - offset) {
+      std::ostringstream oss;
+      oss << "range " << offset << "+" << size << " out of memory of size " << mem.size();
+      throw std::runtime_error(oss.str());
+    }
+
+    return range { as_ptr(mem.data()) + offset, size };
+  }
+
+  void vm_prefetch(const range &absolute_range) {
+    auto aligned = page_aligned(absolute_range);
+    if (aligned.size > 0) {
+      vm_populate(aligned.address, aligned.size);
+    }
+  }
+
+  std::map<int, size_t> vm_numa_residency(const memory &mem) {
+    std::map<int, size_t> residency;
+
+#ifdef __linux__
+    const size_t page_size = 4096;
+    const size_t batch_size = 4096;
+    std::vector<void *> pages(batch_size);
+    std::vector<int> status(batch_size);
+
+    const auto begin = as_ptr(mem.data());
+    const auto end = begin + mem.size();
+    for (auto address = begin; address < end; ) {
+      size_t count = 0;
+      for (; count < batch_size && address < end; ++count, address += page_size) {
+        pages[count] = as_ptr(address);
+      }
+
+      oscalls::move_pages(0, count, pages.data(), static_cast<const int *>(nullptr), status.data(), 0);
+
+      // negative status for pages not present (-ENOENT) or not mapped (-EFAULT)
+      for (size_t i = 0; i < count; ++i) {
+        if (status[i] >= 0) {
+          residency[status[i]] += page_size;
+        }
+      }
+    }
+#endif
+
+    return residency;
+  }
+
+  void vm_advise(const range &absolute_range, access_pattern pattern) {
+    auto aligned = page_aligned(absolute_range);
+    if (aligned.size > 0) {
+      vm_madvise(aligned.address, aligned.size, get_advice(pattern));
+    }
   }
 }
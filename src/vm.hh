@@ -1,5 +1,8 @@
 #pragma once
 
+#include <map>
+#include <vector>
+
 namespace experiment {
 
   struct memory {
@@ -10,10 +13,55 @@ namespace experiment {
     virtual std::size_t size() const = 0;
   };
 
-  std::shared_ptr<memory> create_cow();
+  // absolute address range in the process address space
+  struct range {
+    uintptr_t address;
+    size_t size;
+  };
+
+  // kernel hints on how a range will be accessed (madvise)
+  enum class access_pattern {
+    normal,
+    sequential,
+    random,
+    willneed,
+    cold,    // linux >= 5.4
+    pageout  // linux >= 5.4
+  };
+
+  // where pages of a memory are placed on NUMA hosts (linux only)
+  struct numa_placement {
+    enum class policy_type {
+      none,       // first touch
+      bind,       // to nodes
+      interleave, // across nodes
+      local       // prefer the node of the creating thread
+    };
+
+    policy_type policy = policy_type::none;
+    std::vector<int> nodes;
+  };
+
+  std::shared_ptr<memory> create_cow(const numa_placement &placement = {});
   bool handle_cow(uintptr_t fault_data_address);
 
-  std::shared_ptr<memory> create_vm(size_t reservation_size);
-  int vm_map_file(const std::string &path, uintptr_t offset, size_t size, bool writable);
+  std::shared_ptr<memory> create_vm(size_t reservation_size, const numa_placement &placement = {});
+  int vm_map_file(const std::string &path, uintptr_t offset, size_t size, bool writable, access_pattern pattern = access_pattern::normal);
   void vm_unmap_file(int id);
+
+  // range with the memory it belongs to, keeping its reservation alive while the range is used
+  struct owned_range {
+    range absolute;
+    std::shared_ptr<memory> owner;
+  };
+
+  // resolve a range relative to a mapping, throws if out of its bounds
+  owned_range vm_mapping_range(int id, uintptr_t offset, size_t size);
+  // resolve a range relative to a memory data, throws if out of its bounds
+  range vm_memory_range(const memory &mem, uintptr_t offset, size_t size);
+  // blocking, meant to be called from a worker thread
+  void vm_prefetch(const range &absolute_range);
+  void vm_advise(const range &absolute_range, access_pattern pattern);
+  // resident bytes per numa node
+  std::map<int, size_t> vm_numa_residency(const memory &mem);
 }
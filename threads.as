@@ -0,0 +1,15 @@
+export function sum(address: usize, length: usize): u32 {
+  let total: u32 = 0;
+  for (let i: usize = 0; i < length; ++i) {
+    total += load<u8>(address + i);
+  }
+  return total;
+}
+
+export function atomicAdd(address: usize, value: u32): void {
+  atomic.add<u32>(address, value);
+}
+
+export function atomicRead(address: usize): u32 {
+  return atomic.load<u32>(address);
+}
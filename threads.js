@@ -0,0 +1,83 @@
+"use strict";
+
+const path = require("path");
+const fs = require("fs");
+const { Worker, isMainThread, workerData } = require("worker_threads");
+const asc = require("assemblyscript/cli/asc");
+const loader = require("assemblyscript/lib/loader");
+const wamem = require("./build/Release/wamem");
+
+// https://www.assemblyscript.org/memory.html#internals
+
+const FILE = "/tmp/as-test-threads";
+const RESULT_FILE = "/tmp/as-test-threads-result";
+const WORKERS = 4;
+const CHUNK = 4096;
+
+if (isMainThread) {
+  main();
+} else {
+  worker();
+}
+
+async function main() {
+  await asc.ready;
+
+  wamem.setupTrap();
+
+  console.time("compileString");
+  const script = fs.readFileSync(path.join(__dirname, "threads.as"), "utf-8");
+  console.timeEnd("compileString");
+
+  const reservation = 512 * 1024 * 1024;
+
+  const { binary } = asc.compileString(script, {
+    optimize: 2,
+    runtime: "stub", // several instances share the heap, they must not allocate
+    importMemory: true,
+    sharedMemory: true,
+    maximumMemory: 16385, // pages of the custom memory (VM_ALLOCATABLE_SIZE), above the initial size set by memoryBase
+    enable: ["threads"],
+    memoryBase: reservation, // at COMPILE time
+  });
+
+  const memory = wamem.createMemory(reservation, { shared: true });
+
+  const content = Buffer.alloc(WORKERS * CHUNK, 1);
+  fs.writeFileSync(FILE, content);
+  fs.writeFileSync(RESULT_FILE, Buffer.alloc(CHUNK));
+
+  const id = wamem.vmMapFile(FILE, 0, content.length, false, "sequential");
+  const resultId = wamem.vmMapFile(RESULT_FILE, content.length, CHUNK, true);
+  await wamem.vmPrefetch(id, [[0, content.length]]);
+
+  console.time("workers");
+  await Promise.all(
+    Array.from({ length: WORKERS }, (_, index) => {
+      const worker = new Worker(__filename, {
+        workerData: { binary, memory, address: index * CHUNK, length: CHUNK, result: content.length },
+      });
+      return new Promise((resolve, reject) => {
+        worker.on("error", reject);
+        worker.on("exit", resolve);
+      });
+    })
+  );
+  console.timeEnd("workers");
+
+  const module = await loader.instantiate(binary, { env: { memory } });
+  console.log("should be", content.length, module.exports.atomicRead(content.length));
+
+  wamem.vmUnmapFile(resultId);
+  wamem.vmUnmapFile(id);
+}
+
+async function worker() {
+  const { binary, memory, address, length, result } = workerData;
+
+  // same memory, instantiated in the worker isolate
+  const module = await loader.instantiate(binary, { env: { memory } });
+  const { sum, atomicAdd } = module.exports;
+
+  atomicAdd(result, sum(address, length));
+}